@@ -0,0 +1,45 @@
+#ifndef __COMMIT_LOG_H__
+#define __COMMIT_LOG_H__
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define ERROR_COMMIT_LOG_WRAPPED 1100
+#define ERROR_COMMIT_LOG_BAD_CAPACITY 1101
+#define ERROR_COMMIT_LOG_NO_MEMORY 1102
+
+// Stamp of a transaction that was never validated. Forces a full scan.
+// The clock starts right after it, so any real stamp is always greater.
+#define COMMIT_LOG_NEVER 0UL
+
+typedef unsigned long commit_stamp_t;
+
+typedef struct {
+    _Atomic commit_stamp_t stamp;  // 0 while the slot is being written or was never published
+    _Atomic size_t index;  // lock table index written by the commit
+} commit_entry_t;
+
+/// Ring of lock table indices changed by committed transactions,
+/// ordered by a global clock. A committer must update the lock table
+/// *before* calling ``commit_log_append``: any reader that observes
+/// ``commit_log_now() >= s`` then also observes the lock written under ``s``.
+typedef struct {
+    _Atomic commit_stamp_t clock;
+    size_t capacity;  // always a power of two
+    commit_entry_t *entries;
+} commit_log_t;
+
+/// ``fn`` is called once per logged index falling in the requested range.
+/// A non-zero return value stops the iteration and is propagated.
+typedef int (*commit_log_fn)(size_t index, void *arg);
+
+int commit_log_init(commit_log_t *log, size_t capacity);
+void commit_log_destroy(commit_log_t *log);
+
+commit_stamp_t commit_log_append(commit_log_t *log, size_t index);
+#define commit_log_now(_log) (atomic_load_explicit(&(_log)->clock, memory_order_acquire))
+
+int commit_log_for_each(commit_log_t *log, commit_stamp_t since, commit_stamp_t until,
+                        size_t first, size_t last, commit_log_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef __HOST_PROFILER_H__
+#define __HOST_PROFILER_H__
+
+#include <stddef.h>
+
+#define ERROR_HPC_DISABLED 1200
+#define ERROR_HPC_IO 1201
+#define ERROR_HPC_UNAVAILABLE 1202  // perf_event_open failed in every thread
+
+// Environment variable naming the CSV the counters are appended to.
+// Counting is off at runtime when it is not set.
+#define HPC_CSV_ENV "HOST_PROFILER_CSV"
+
+typedef enum {
+    HPC_POPULATE_READSET,
+    HPC_VALIDATE_HOST,
+    HPC_MAP,
+    HPC_UNMAP,
+    HPC_ENQUEUE,
+    HPC_PHASES
+} hpc_phase_t;
+
+typedef enum {
+    HPC_CYCLES,
+    HPC_INSTRUCTIONS,
+    HPC_LLC_MISSES,
+    HPC_DTLB_MISSES,
+    HPC_COUNTERS
+} hpc_counter_t;
+
+#ifdef ENABLE_HOST_PROFILER
+int hpc_init(void);
+void _hpc_begin(hpc_phase_t phase);
+void _hpc_end(hpc_phase_t phase);
+void _hpc_thread_close(void);
+int _hpc_export_csv(int host_only, size_t dataset_size, unsigned int threads);
+
+#define hpc_begin(_phase) _hpc_begin(_phase)
+#define hpc_end(_phase) _hpc_end(_phase)
+#define hpc_thread_close() _hpc_thread_close()
+#define hpc_export_csv(_host_only, _dataset_size, _threads) _hpc_export_csv(_host_only, _dataset_size, _threads)
+#else
+static inline int hpc_init(void) { return -ERROR_HPC_DISABLED; }
+#define hpc_begin(_phase)
+#define hpc_end(_phase)
+#define hpc_thread_close()
+#define hpc_export_csv(_host_only, _dataset_size, _threads) (-ERROR_HPC_DISABLED)
+#endif
+
+#endif
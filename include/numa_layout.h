@@ -0,0 +1,38 @@
+#ifndef __NUMA_LAYOUT_H__
+#define __NUMA_LAYOUT_H__
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define ERROR_NUMA_BAD_MODE 1300
+#define ERROR_NUMA_NO_MEMORY 1301
+
+#define NUMA_LAYOUT_OFF 0  // malloc'd table, threads left to the scheduler
+#define NUMA_LAYOUT_INTERLEAVE 1  // table pages spread round robin, threads pinned round robin on nodes
+#define NUMA_LAYOUT_PARTITION 2  // one contiguous slice per node, threads pinned on the node owning their range
+
+/// Nodes and cpus the host lock table and its validators are laid out on.
+/// Without libnuma (built without NUMA=1) or on a single node machine
+/// everything collapses to node 0 holding every online cpu.
+typedef struct {
+    int mode;
+    int num_nodes;  // nodes with at least one cpu
+    int *node_ids;  // OS id of each node
+    int *cpus;  // cpus grouped by node
+    int *node_cpus;  // num_nodes + 1 offsets into cpus
+    int *next_cpu;  // round robin cursor of each node
+    size_t table_size;  // mapped bytes, page aligned
+    size_t node_span;  // bytes owned by each node in NUMA_LAYOUT_PARTITION
+} numa_layout_t;
+
+int numa_layout_init(numa_layout_t *layout, int mode, long num_cpus);
+void numa_layout_destroy(numa_layout_t *layout);
+
+void *numa_alloc_table(numa_layout_t *layout, size_t size);
+void numa_free_table(numa_layout_t *layout, void *table);
+
+int numa_validator_node(const numa_layout_t *layout, size_t offset, int tid);
+int numa_current_node(const numa_layout_t *layout);
+int numa_thread_attr(numa_layout_t *layout, int node, pthread_attr_t *attr);
+
+#endif
@@ -25,6 +25,16 @@
 #define SH_BUF_WRITE CL_MEM_WRITE_ONLY
 #define SH_BUF_RW CL_MEM_READ_WRITE
 
+// Where the data of a shared buffer lives, see select_buffer_strategy
+#define SH_BUF_ZERO_COPY 0  // CL_MEM_USE_HOST_PTR on page aligned host memory
+#define SH_BUF_PINNED 1  // CL_MEM_ALLOC_HOST_PTR, mapped in place by the runtime
+#define SH_BUF_DEVICE 2  // device memory, explicit copies from/to a host staging area
+
+// How a shared buffer is going to be used
+#define SH_ACCESS_SHARED 0  // host and device access it back and forth
+#define SH_ACCESS_HOST_TO_DEVICE 1  // filled by the host, then read by the device
+#define SH_ACCESS_DEVICE_TO_HOST 2  // written by the device, read back by the host
+
 typedef struct {
     cl_platform_id platform;
     cl_device_id device;
@@ -32,6 +42,10 @@ typedef struct {
     cl_command_queue queues[MAX_QUEUES];
     unsigned char allocated_queues;
     char *device_name;
+    cl_bool host_unified_memory;
+    double map_bandwidth;  // bytes/s writing through a mapped pinned buffer, 0 if unknown
+    double copy_bandwidth;  // bytes/s writing into device memory with an explicit copy, 0 if unknown
+    unsigned char bandwidth_probed;  // bandwidths are only probed when a strategy depends on them
 } env_t;
 
 typedef struct {
@@ -72,9 +86,13 @@ typedef struct {
     size_t total_size;  // buffer may be padded to be multiple of cache line size. always >= requested_size.
     env_t *env;
     cl_mem device_handler;
-    void *host_handler;
+    void *host_handler;  // NULL for SH_BUF_PINNED, staging area for SH_BUF_DEVICE
     void *mapped_ptr;
     cl_command_queue queued_on;
+    cl_mem_flags mem_flags;
+    cl_map_flags map_flags;
+    cl_event pending_copy;  // last asynchronous host to device copy, SH_BUF_DEVICE only
+    int strategy;
 } shared_buf_t;
 
 #ifdef ENABLE_KERNEL_PROFILER
@@ -116,7 +134,10 @@ int env_enqueue_kernel(env_kernel_t *kernel, queue_id_t q_id, unsigned int work_
 
 size_t get_cache_size(const env_t *env);
 
-shared_buf_t *create_shared_buffer(size_t size, env_t *env, cl_mem_flags);
+int select_buffer_strategy(env_t *env, size_t size, int access);
+const char *buffer_strategy_name(int strategy);
+shared_buf_t *create_shared_buffer_for(size_t size, env_t *env, cl_mem_flags flags, int access);
+#define create_shared_buffer(_size, _env, _flags) create_shared_buffer_for(_size, _env, _flags, SH_ACCESS_SHARED)
 void destroy_shared_buffer(shared_buf_t *buf);
 void *map_shbuf(shared_buf_t *buf, queue_id_t q_id, cl_map_flags flags);
 void unmap_shbuf(shared_buf_t *buf);
@@ -1,6 +1,8 @@
+#define _POSIX_C_SOURCE 200809L  // clock_gettime
 #include <env.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #define _MAX_PLATFORMS 8
 #define _MAX_DEVICES 5
@@ -14,6 +16,8 @@
 #define PAGE_SIZE 4096
 #define CACHE_LINE_SIZE 64
 
+#define _PROBE_SIZE (4 * 1024 * 1024)
+
 #ifdef ENABLE_KERNEL_PROFILER
 typedef struct {
     env_kernel_t *kernel;
@@ -63,6 +67,101 @@ static cl_command_queue get_queue(env_t *env, queue_id_t id) {
     return env->queues[id];
 }
 
+static double elapsed_sec(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (double) (end->tv_nsec - start->tv_nsec) / 1000000000;
+}
+
+/// Times one host write of _PROBE_SIZE bytes into a pinned buffer
+/// through map/unmap. Returns bytes/s or 0 on error.
+static double probe_map_bandwidth(env_t *env, cl_command_queue q) {
+    cl_int cl_reterr;
+    struct timespec start, end;
+    double ret = 0;
+    cl_mem mem = clCreateBuffer(env->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, _PROBE_SIZE, NULL, &cl_reterr);
+    if(cl_reterr != CL_SUCCESS) {
+        return 0;
+    }
+    // first round only warms up the allocation
+    for(int i = 0; i < 2; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        void *ptr = clEnqueueMapBuffer(q, mem, CL_TRUE, CL_MAP_WRITE, 0, _PROBE_SIZE, 0, NULL, NULL, &cl_reterr);
+        if(cl_reterr != CL_SUCCESS) {
+            goto clean_exit;
+        }
+        memset(ptr, i, _PROBE_SIZE);
+        clEnqueueUnmapMemObject(q, mem, ptr, 0, NULL, NULL);
+        clFinish(q);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    }
+    ret = _PROBE_SIZE / elapsed_sec(&start, &end);
+
+clean_exit:
+    clReleaseMemObject(mem);
+    return ret;
+}
+
+/// Times one host write of _PROBE_SIZE bytes into a device buffer
+/// through an explicit copy. Returns bytes/s or 0 on error.
+static double probe_copy_bandwidth(env_t *env, cl_command_queue q) {
+    cl_int cl_reterr;
+    struct timespec start, end;
+    double ret = 0;
+    void *host = aligned_alloc(PAGE_SIZE, _PROBE_SIZE);
+    if(!host) {
+        return 0;
+    }
+    cl_mem mem = clCreateBuffer(env->context, CL_MEM_READ_WRITE, _PROBE_SIZE, NULL, &cl_reterr);
+    if(cl_reterr != CL_SUCCESS) {
+        free(host);
+        return 0;
+    }
+    for(int i = 0; i < 2; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        memset(host, i, _PROBE_SIZE);
+        cl_reterr = clEnqueueWriteBuffer(q, mem, CL_TRUE, 0, _PROBE_SIZE, host, 0, NULL, NULL);
+        if(cl_reterr != CL_SUCCESS) {
+            goto clean_exit;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    }
+    ret = _PROBE_SIZE / elapsed_sec(&start, &end);
+
+clean_exit:
+    clReleaseMemObject(mem);
+    free(host);
+    return ret;
+}
+
+/// Queries whether the device shares memory with the host, for
+/// select_buffer_strategy. Failures are not fatal: the device is then
+/// assumed to be unified, which keeps the zero-copy behaviour.
+static void probe_memory_model(env_t *env) {
+    cl_int cl_reterr = clGetDeviceInfo(env->device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &(env->host_unified_memory), NULL);
+    if(cl_reterr != CL_SUCCESS) {
+        env->host_unified_memory = CL_TRUE;
+    }
+    env->map_bandwidth = 0;
+    env->copy_bandwidth = 0;
+    env->bandwidth_probed = 0;
+}
+
+/// Measures how fast the host can hand data over to the device, once.
+/// Only done on demand, as the probe costs a few 4 MB transfers.
+static void probe_transfer_bandwidth(env_t *env) {
+    cl_int cl_reterr;
+    if(env->bandwidth_probed) {
+        return;
+    }
+    env->bandwidth_probed = 1;
+    cl_command_queue q = clCreateCommandQueue(env->context, env->device, 0, &cl_reterr);
+    if(cl_reterr != CL_SUCCESS) {
+        return;
+    }
+    env->map_bandwidth = probe_map_bandwidth(env, q);
+    env->copy_bandwidth = probe_copy_bandwidth(env, q);
+    clReleaseCommandQueue(q);
+}
+
 int env_init(env_t *env, int platform) {
     int ret = 0;
     cl_platform_id platforms[_MAX_PLATFORMS];
@@ -111,6 +210,7 @@ int env_init(env_t *env, int platform) {
 
     env->allocated_queues = 0;
     env->device_name = NULL;
+    probe_memory_model(env);
 
 clean_exit:
     return ret;
@@ -317,7 +417,39 @@ size_t get_cache_size(const env_t *env) {
     return 0;
 }
 
-shared_buf_t *create_shared_buffer(size_t size, env_t *env, cl_mem_flags flags) {
+/// Picks where a buffer of ``size`` bytes used as ``access`` should live.
+/// On unified memory devices the host allocation is the device memory,
+/// so zero-copy never moves data. Results read back by the host and
+/// buffers under a page, where the latency of a copy dominates, are pinned.
+/// Otherwise the host-to-device path measured faster wins: data the device
+/// reads over and over goes to device memory unless mapping is faster,
+/// shared buffers only when two copies still beat mapping.
+/// The bandwidths are probed the first time such a choice is needed.
+int select_buffer_strategy(env_t *env, size_t size, int access) {
+    if(env->host_unified_memory) {
+        return SH_BUF_ZERO_COPY;
+    }
+    if(access == SH_ACCESS_DEVICE_TO_HOST || size < PAGE_SIZE) {
+        return SH_BUF_PINNED;
+    }
+    probe_transfer_bandwidth(env);
+    if(access == SH_ACCESS_HOST_TO_DEVICE) {
+        return env->copy_bandwidth >= env->map_bandwidth ? SH_BUF_DEVICE : SH_BUF_PINNED;
+    }
+    // a shared buffer is copied in and back out again
+    return env->copy_bandwidth / 2 > env->map_bandwidth ? SH_BUF_DEVICE : SH_BUF_PINNED;
+}
+
+const char *buffer_strategy_name(int strategy) {
+    switch (strategy) {
+        case SH_BUF_ZERO_COPY: return "zero-copy";
+        case SH_BUF_PINNED: return "pinned";
+        case SH_BUF_DEVICE: return "device";
+    }
+    return "NA";
+}
+
+shared_buf_t *create_shared_buffer_for(size_t size, env_t *env, cl_mem_flags flags, int access) {
     cl_int cl_reterr;
     shared_buf_t *ret = (shared_buf_t *) malloc(sizeof(shared_buf_t));
     if(!ret) return ret;  // if allocation fails return NULL
@@ -328,13 +460,26 @@ shared_buf_t *create_shared_buffer(size_t size, env_t *env, cl_mem_flags flags)
     if(size % CACHE_LINE_SIZE) {
         size += (CACHE_LINE_SIZE - size % CACHE_LINE_SIZE);
     }
-    ret->host_handler = aligned_alloc(PAGE_SIZE, size);
-    if(!(ret->host_handler)) {  // if aligned allocation fails return NULL
-        free(ret);
-        return NULL;
+    ret->strategy = select_buffer_strategy(env, size, access);
+    ret->host_handler = NULL;
+    if(ret->strategy != SH_BUF_PINNED) {
+        ret->host_handler = aligned_alloc(PAGE_SIZE, size);
+        if(!(ret->host_handler)) {  // if aligned allocation fails return NULL
+            free(ret);
+            return NULL;
+        }
     }
 
-    ret->device_handler = clCreateBuffer(env->context, flags | CL_MEM_USE_HOST_PTR, size, ret->host_handler, &cl_reterr);
+    switch (ret->strategy) {
+        case SH_BUF_ZERO_COPY:
+            ret->device_handler = clCreateBuffer(env->context, flags | CL_MEM_USE_HOST_PTR, size, ret->host_handler, &cl_reterr);
+            break;
+        case SH_BUF_PINNED:
+            ret->device_handler = clCreateBuffer(env->context, flags | CL_MEM_ALLOC_HOST_PTR, size, NULL, &cl_reterr);
+            break;
+        default:
+            ret->device_handler = clCreateBuffer(env->context, flags, size, NULL, &cl_reterr);
+    }
     if(cl_reterr != CL_SUCCESS) {
         free(ret->host_handler);
         free(ret);
@@ -343,27 +488,66 @@ shared_buf_t *create_shared_buffer(size_t size, env_t *env, cl_mem_flags flags)
     ret->env = env;
     ret->mapped_ptr = NULL;
     ret->queued_on = NULL;
+    ret->mem_flags = flags;
+    ret->map_flags = 0;
+    ret->pending_copy = NULL;
     ret->size = requested_size;
     ret->total_size = size;
     return ret;
 }
 
+static void wait_pending_copy(shared_buf_t *buf) {
+    if(buf->pending_copy) {
+        clWaitForEvents(1, &(buf->pending_copy));
+        clReleaseEvent(buf->pending_copy);
+        buf->pending_copy = NULL;
+    }
+}
+
 void destroy_shared_buffer(shared_buf_t *buf) {
-    free(buf->host_handler);
+    wait_pending_copy(buf);
     clReleaseMemObject(buf->device_handler);
+    free(buf->host_handler);
     free(buf);
 }
 
+/// For SH_BUF_DEVICE buffers the staging area is returned. It is refreshed
+/// from the device unless it is mapped write-only and either the device
+/// cannot have written to it or the caller discards the old contents
+/// (CL_MAP_WRITE_INVALIDATE_REGION), which makes populating it a single copy.
 void *map_shbuf(shared_buf_t *buf, queue_id_t q_id, cl_map_flags flags) {
     cl_int ret;
     cl_command_queue queue = get_queue(buf->env, q_id);
-    buf->mapped_ptr = clEnqueueMapBuffer(queue, buf->device_handler, CL_TRUE, flags, 0, buf->size, 0, NULL, NULL, &ret);
+    if(buf->strategy == SH_BUF_DEVICE) {
+        wait_pending_copy(buf);
+        int stale = !(buf->mem_flags & CL_MEM_READ_ONLY) && !(flags & CL_MAP_WRITE_INVALIDATE_REGION);
+        if((flags & CL_MAP_READ) || stale) {
+            ret = clEnqueueReadBuffer(queue, buf->device_handler, CL_TRUE, 0, buf->size, buf->host_handler, 0, NULL, NULL);
+            if(ret != CL_SUCCESS) {
+                return NULL;
+            }
+        }
+        buf->mapped_ptr = buf->host_handler;
+    } else {
+        buf->mapped_ptr = clEnqueueMapBuffer(queue, buf->device_handler, CL_TRUE, flags, 0, buf->size, 0, NULL, NULL, &ret);
+    }
     buf->queued_on = queue;
+    buf->map_flags = flags;
     return buf->mapped_ptr;
 }
 
+/// For SH_BUF_DEVICE buffers mapped for writing (CL_MAP_WRITE or
+/// CL_MAP_WRITE_INVALIDATE_REGION) the staging area is copied back
+/// asynchronously; commands enqueued afterwards on the same queue see it.
 void unmap_shbuf(shared_buf_t *buf) {
-    clEnqueueUnmapMemObject(buf->queued_on, buf->device_handler, buf->mapped_ptr, 0, NULL, NULL);
+    if(buf->strategy == SH_BUF_DEVICE) {
+        if(buf->map_flags & (CL_MAP_WRITE | CL_MAP_WRITE_INVALIDATE_REGION)) {
+            clEnqueueWriteBuffer(buf->queued_on, buf->device_handler, CL_FALSE, 0, buf->size, buf->host_handler, 0, NULL, &(buf->pending_copy));
+        }
+    } else {
+        clEnqueueUnmapMemObject(buf->queued_on, buf->device_handler, buf->mapped_ptr, 0, NULL, NULL);
+    }
     buf->mapped_ptr = NULL;
     buf->queued_on = NULL;
+    buf->map_flags = 0;
 }
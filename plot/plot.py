@@ -20,12 +20,20 @@ cpu_legend = mlines.Line2D([], [], color='red', marker='o', markersize=15, label
 def formatter(x, pos=None):
     return str(x) if x < 1 else str(int(x))
 
+def export_host_counters(csv_name):
+    # counters are only written when the program is built with `make HOST_PROFILER=1`
+    hpc_csv = "hpc_" + csv_name
+    if os.path.exists(hpc_csv):
+        os.remove(hpc_csv)
+    os.environ["HOST_PROFILER_CSV"] = os.path.abspath(hpc_csv)
+
 def ratio():
     dataset_sizes = [(2**x*1.0)/(1024*1024) for x in range(18, 29)]  # 1KB to 256MB
     ys = []
     num_threads = 1
 
     rows = [["Dataset size (MB)", "With GPU", "Without GPU", "CPU/GPU ratio"]]
+    export_host_counters("csv_{0}thread_O0.csv".format(num_threads))
 
     for i in dataset_sizes:
         print("executing with dataset size={0}".format(i))
@@ -84,6 +92,7 @@ def vary_dataset():
     num_threads = 1
 
     rows = [["Dataset size (KB)", "With GPU", "Without GPU"]]
+    export_host_counters("csv_{0}thread.csv".format(num_threads))
 
     for i in dataset_sizes:
         print("executing with dataset size={0}".format(i))
@@ -187,6 +196,58 @@ def cache_limits():
         plt.suptitle('dataset {0} cache size [{1}/{2}] (all levels full)'.format(arg['name'], arg['value'], cache_sz), fontsize=12, fontweight='bold')
         plt.savefig('plot_dataset_{0}_cache_all.png'.format(arg['name']))
 
+def _run_numa(nthreads, layout, dataset_size):
+    cmd = [executable, "1", str(dataset_size), os.path.join(path, "src", "kernels", "main.cl"), str(nthreads), "0", str(layout)]
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    out, err = proc.communicate()
+    # per node lines look like "node 0: 1048576 bytes, 123456 cycles, 8.4934 bytes/cycle"
+    nodes = {}
+    for line in err.split("\n"):
+        if line.startswith("node "):
+            node, stats = line[len("node "):].split(":")
+            nodes[int(node)] = float(stats.split(",")[-1].split()[0])
+    return float(out), nodes
+
+def numa_layouts():
+    # needs a `make NUMA=1` build, per node figures are only printed by DEBUG builds
+    dataset_size = 256 * 1024 * 1024
+    threads = [1] + range(2, 18, 2)
+    layouts = [(0, 'default'), (1, 'interleave'), (2, 'partition')]
+    rows = [["Threads", "Layout", "Node", "Bytes/cycle"]]
+
+    for layout in layouts:
+        ys = []
+        ys_nodes = {}
+        for nthreads in threads:
+            runs = sorted([_run_numa(nthreads, layout[0], dataset_size) for __ in range(num_iters)], key=lambda r: r[0])
+            cycles, nodes = runs[num_iters // 2]
+            ys.append(dataset_size / cycles)
+            rows.append([nthreads, layout[1], "all", dataset_size / cycles])
+            for node, bandwidth in sorted(nodes.items()):
+                ys_nodes.setdefault(node, []).append(bandwidth)
+                rows.append([nthreads, layout[1], node, bandwidth])
+        plt.figure(0)
+        plt.plot(threads, ys, '-.o', markersize=7, label=layout[1])
+        if ys_nodes:
+            plt.figure(1)
+            for node, ys_node in sorted(ys_nodes.items()):
+                plt.plot(threads[:len(ys_node)], ys_node, '-.^', markersize=7, label='{0} node {1}'.format(layout[1], node))
+
+    for fig, name in [(0, 'all nodes'), (1, 'per node')]:
+        plt.figure(fig)
+        ax = plt.gca()
+        ax.set_xlabel('Number of CPU threads')
+        ax.set_ylabel('bytes validated / cycle')
+        plt.legend()
+        plt.grid(linestyle="dotted")
+        plt.suptitle('host lock table layout, {0}'.format(name), fontsize=14, fontweight='bold')
+        plt.savefig('plot_numa_{0}.png'.format(name.replace(' ', '_')))
+
+    with open("csv_numa_layouts.csv", 'wb') as csv_file:
+        writer = csv.writer(csv_file, quoting=csv.QUOTE_MINIMAL)
+        writer.writerows(rows)
+
 ratio()
 #vary_dataset()
+#numa_layouts()
 #cache_limits()
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include <commit_log.h>
+#include <stdlib.h>
+
+#define slot_of(_log, _stamp) ((_log)->entries + ((_stamp) & ((_log)->capacity - 1)))
+
+int commit_log_init(commit_log_t *log, size_t capacity) {
+    // capacity must be a power of two so that a slot is just a mask away
+    if(!capacity || (capacity & (capacity - 1))) {
+        return -ERROR_COMMIT_LOG_BAD_CAPACITY;
+    }
+    log->entries = (commit_entry_t *) calloc(capacity, sizeof(commit_entry_t));
+    if(!log->entries) {
+        return -ERROR_COMMIT_LOG_NO_MEMORY;
+    }
+    for(size_t i = 0; i < capacity; i++) {
+        atomic_init(&(log->entries[i].stamp), 0);
+        atomic_init(&(log->entries[i].index), 0);
+    }
+    atomic_init(&(log->clock), COMMIT_LOG_NEVER + 1);
+    log->capacity = capacity;
+    return 0;
+}
+
+void commit_log_destroy(commit_log_t *log) {
+    free(log->entries);
+    log->entries = NULL;
+}
+
+/// Records that ``index`` was changed and returns the stamp assigned
+/// to the change. The slot is written like a seqlock: it is invalidated
+/// before the index is stored and published once the index is in place,
+/// so a reader can never pair the old stamp with the new index.
+commit_stamp_t commit_log_append(commit_log_t *log, size_t index) {
+    commit_stamp_t stamp = atomic_fetch_add_explicit(&(log->clock), 1, memory_order_acq_rel) + 1;
+    commit_entry_t *entry = slot_of(log, stamp);
+    // the previous owner of the slot may not have published yet,
+    // let it finish so that its stamp cannot land on top of ours
+    if(stamp - COMMIT_LOG_NEVER > log->capacity + 1) {
+        while(atomic_load_explicit(&(entry->stamp), memory_order_acquire) < stamp - log->capacity);
+    }
+    atomic_store_explicit(&(entry->stamp), 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&(entry->index), index, memory_order_relaxed);
+    atomic_store_explicit(&(entry->stamp), stamp, memory_order_release);
+    return stamp;
+}
+
+/// Walks the changes stamped in (``since``, ``until``] and calls ``fn``
+/// for the ones whose index is in [``first``, ``last``).
+/// Returns 0 when every change was visited, the first non-zero value
+/// returned by ``fn``, or -ERROR_COMMIT_LOG_WRAPPED if part of the window
+/// was overwritten: the caller must then fall back to a full scan.
+int commit_log_for_each(commit_log_t *log, commit_stamp_t since, commit_stamp_t until,
+                        size_t first, size_t last, commit_log_fn fn, void *arg) {
+    if(since == COMMIT_LOG_NEVER || until - since > log->capacity) {
+        return -ERROR_COMMIT_LOG_WRAPPED;
+    }
+    for(commit_stamp_t s = since + 1; s <= until; s++) {
+        commit_entry_t *entry = slot_of(log, s);
+        commit_stamp_t seen;
+        // wait for a committer that already took its stamp but did not publish it yet
+        while((seen = atomic_load_explicit(&(entry->stamp), memory_order_acquire)) < s);
+        if(seen != s) {
+            return -ERROR_COMMIT_LOG_WRAPPED;
+        }
+        size_t index = atomic_load_explicit(&(entry->index), memory_order_relaxed);
+        // the slot may have been recycled while we were reading it: a writer
+        // invalidates the stamp before touching the index, so seeing ``s``
+        // again means ``index`` belongs to ``s``
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&(entry->stamp), memory_order_relaxed) != s) {
+            return -ERROR_COMMIT_LOG_WRAPPED;
+        }
+        if(index >= first && index < last) {
+            int ret = fn(index, arg);
+            if(ret) {
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+#define _GNU_SOURCE  // syscall()
+#include <host_profiler.h>
+
+#ifdef ENABLE_HOST_PROFILER
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef LINUX
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// time_enabled and time_running are kept in front of the counter values
+#define _SNAPSHOT_SZ (HPC_COUNTERS + 2)
+
+typedef struct {
+    unsigned long long calls;
+    unsigned long long counts[HPC_COUNTERS];
+} hpc_totals_t;
+
+typedef struct {
+    int opened;  // 0 not tried yet, 1 counting, -1 counters unavailable
+    int leader;
+    int fds[HPC_COUNTERS];
+    int slot[HPC_COUNTERS];  // position of the counter in a group read, -1 if not supported
+    unsigned long long start[HPC_PHASES][_SNAPSHOT_SZ];
+    unsigned char started[HPC_PHASES];  // start holds a good snapshot
+    hpc_totals_t totals[HPC_PHASES];
+} hpc_thread_t;
+
+static int enabled = 0;
+static hpc_totals_t totals[HPC_PHASES];
+static int counted = 0;  // some thread folded real counts into totals
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local hpc_thread_t tls;
+
+static const char *phase_names[HPC_PHASES] = {
+    "populate_readset",
+    "validate_host",
+    "map",
+    "unmap",
+    "enqueue"
+};
+
+#ifdef LINUX
+static const struct {
+    __u32 type;
+    __u64 config;
+} counter_events[HPC_COUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},  // last level cache on most PMUs
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+                         | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                         | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)}
+};
+
+/// Opens one counter group for the calling thread. Counters the PMU
+/// does not support are skipped, if none can be opened the thread
+/// is marked as unavailable and every phase becomes a no-op.
+static void open_group(hpc_thread_t *t) {
+    struct perf_event_attr attr;
+    int nr = 0;
+    t->leader = -1;
+    for(int c = 0; c < HPC_COUNTERS; c++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter_events[c].type;
+        attr.config = counter_events[c].config;
+        attr.disabled = t->leader < 0;  // members follow the leader
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        t->fds[c] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, t->leader, 0);
+        if(t->fds[c] < 0) {
+            t->slot[c] = -1;
+            continue;
+        }
+        if(t->leader < 0) {
+            t->leader = t->fds[c];
+        }
+        t->slot[c] = nr++;
+    }
+    if(t->leader < 0) {
+        t->opened = -1;
+        return;
+    }
+    ioctl(t->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    t->opened = 1;
+}
+
+static int read_group(hpc_thread_t *t, unsigned long long *snapshot) {
+    // layout of a PERF_FORMAT_GROUP read: nr, time_enabled, time_running, values[nr]
+    unsigned long long buf[3 + HPC_COUNTERS];
+    if(read(t->leader, buf, sizeof(buf)) < (ssize_t) (3 * sizeof(unsigned long long))) {
+        return -ERROR_HPC_IO;
+    }
+    snapshot[0] = buf[1];
+    snapshot[1] = buf[2];
+    for(int c = 0; c < HPC_COUNTERS; c++) {
+        snapshot[2 + c] = t->slot[c] < 0 ? 0 : buf[3 + t->slot[c]];
+    }
+    return 0;
+}
+
+static void close_group(hpc_thread_t *t) {
+    for(int c = 0; c < HPC_COUNTERS; c++) {
+        if(t->fds[c] >= 0) {
+            close(t->fds[c]);
+        }
+    }
+}
+#else
+static void open_group(hpc_thread_t *t) {
+    t->opened = -1;
+}
+
+static int read_group(hpc_thread_t *t, unsigned long long *snapshot) {
+    return -ERROR_HPC_DISABLED;
+}
+
+static void close_group(hpc_thread_t *t) {}
+#endif  // LINUX
+
+/// Turns counting on when HPC_CSV_ENV names an output file.
+/// Must be called before any worker thread is started.
+int hpc_init(void) {
+#ifdef LINUX
+    enabled = getenv(HPC_CSV_ENV) != NULL;
+#endif
+    return enabled ? 0 : -ERROR_HPC_DISABLED;
+}
+
+void _hpc_begin(hpc_phase_t phase) {
+    if(!enabled) return;
+    if(!tls.opened) {
+        open_group(&tls);
+    }
+    if(tls.opened < 0) return;
+    tls.started[phase] = !read_group(&tls, tls.start[phase]);
+}
+
+/// Accumulates the counts since the matching ``_hpc_begin``. Counters are
+/// never reset, so phases may nest (e.g. map inside populate_readset).
+/// Counts are scaled up when the group was multiplexed with other events.
+/// The phase is dropped when either snapshot could not be read.
+void _hpc_end(hpc_phase_t phase) {
+    unsigned long long now[_SNAPSHOT_SZ];
+    if(!enabled || tls.opened <= 0 || !tls.started[phase]) return;
+    tls.started[phase] = 0;
+    if(read_group(&tls, now)) return;
+
+    unsigned long long *start = tls.start[phase];
+    unsigned long long time_enabled = now[0] - start[0];
+    unsigned long long time_running = now[1] - start[1];
+    double scale = time_running ? (double) time_enabled / time_running : 0;
+    for(int c = 0; c < HPC_COUNTERS; c++) {
+        tls.totals[phase].counts[c] += (unsigned long long) ((now[2 + c] - start[2 + c]) * scale);
+    }
+    tls.totals[phase].calls++;
+}
+
+/// Folds the calling thread's counts into the process totals and releases
+/// its counters. Every thread that used ``hpc_begin`` must call it before exiting.
+void _hpc_thread_close(void) {
+    if(!enabled || tls.opened <= 0) return;
+    pthread_mutex_lock(&totals_lock);
+    counted = 1;
+    for(int p = 0; p < HPC_PHASES; p++) {
+        totals[p].calls += tls.totals[p].calls;
+        for(int c = 0; c < HPC_COUNTERS; c++) {
+            totals[p].counts[c] += tls.totals[p].counts[c];
+        }
+    }
+    pthread_mutex_unlock(&totals_lock);
+    close_group(&tls);
+    memset(&tls, 0, sizeof(tls));
+}
+
+/// Appends one row per phase to the file named by HPC_CSV_ENV,
+/// writing the header first if the file is empty. Nothing is written
+/// when no thread could open its counters, zeros would read as real counts.
+int _hpc_export_csv(int host_only, size_t dataset_size, unsigned int threads) {
+    if(!enabled) {
+        return -ERROR_HPC_DISABLED;
+    }
+    pthread_mutex_lock(&totals_lock);
+    int have_counts = counted;
+    pthread_mutex_unlock(&totals_lock);
+    if(!have_counts) {
+        return -ERROR_HPC_UNAVAILABLE;
+    }
+    FILE *fp = fopen(getenv(HPC_CSV_ENV), "a");
+    if(!fp) {
+        return -ERROR_HPC_IO;
+    }
+    fseek(fp, 0, SEEK_END);
+    if(ftell(fp) == 0) {
+        fprintf(fp, "host_only,dataset_size,threads,phase,calls,cycles,instructions,llc_misses,dtlb_misses\n");
+    }
+    pthread_mutex_lock(&totals_lock);
+    for(int p = 0; p < HPC_PHASES; p++) {
+        fprintf(fp, "%d,%zu,%u,%s,%llu,%llu,%llu,%llu,%llu\n", host_only, dataset_size, threads, phase_names[p],
+                totals[p].calls,
+                totals[p].counts[HPC_CYCLES],
+                totals[p].counts[HPC_INSTRUCTIONS],
+                totals[p].counts[HPC_LLC_MISSES],
+                totals[p].counts[HPC_DTLB_MISSES]);
+    }
+    pthread_mutex_unlock(&totals_lock);
+    fclose(fp);
+    return 0;
+}
+#endif  // ENABLE_HOST_PROFILER
@@ -1,5 +1,8 @@
 #define _XOPEN_SOURCE 700 //for getting timestamps
 #include <env.h>
+#include <commit_log.h>
+#include <host_profiler.h>
+#include <numa_layout.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -11,6 +14,7 @@
 #define get_num_cpus() sysconf(_SC_NPROCESSORS_ONLN)
 #define TXS_NUM 1
 #define READ_SET_PORTION TXS_NUM
+#define COMMIT_LOG_CAPACITY 4096
 
 #define pclock(_ts) printf("%ld.%09ld\n", _ts.tv_sec, _ts.tv_nsec / 1000000)
 
@@ -28,6 +32,12 @@
     res; \
 })
 
+#ifdef DEBUG
+#define report_strategy(_name, _size, _strategy) (fprintf(stderr, "%s: %zu bytes, %s\n", _name, (size_t) (_size), buffer_strategy_name(_strategy)))
+#else
+#define report_strategy(_name, _size, _strategy)
+#endif
+
 struct timespec ts_diff(struct timespec *start, struct timespec *end);
 void *tx_validate(void* _arg);
 void *tx_validate_host_only(void *_arg);
@@ -39,10 +49,25 @@ typedef struct {
     int *ho_glocks;
     size_t ho_glocks_size;
     size_t readset_size;
+    commit_log_t *log;
+    unsigned int revalidations;
+    unsigned int commits;  // commits issued before each revalidation
     env_program_t *program;
     int tid;
+    const numa_layout_t *layout;
+    int node;  // numa node the validator is pinned on, or ran on when not pinned
+    unsigned long long cycles;
 } tx_args_t;
 
+typedef struct {
+    int *read_set;
+    int *glocks;
+    size_t offset;  // lock table index of read_set[0]
+    size_t length;
+} ho_readset_t;
+
+void report_node_bandwidth(const numa_layout_t *layout, const tx_args_t *tx_args, unsigned int thread_num);
+
 struct timespec exec_time;
 unsigned long long start_clock, end_clock;
 
@@ -50,7 +75,7 @@ char *kernel_path = "src/kernels/main.cl";
 
 int main(int argc, char *argv[]) {
     if(argc < 3) {
-        fprintf(stderr, "usage: exec host_only:int dataset_size:int [kernel_file_path:str] [num_threads:int]\n");
+        fprintf(stderr, "usage: exec host_only:int dataset_size:int [kernel_file_path:str] [num_threads:int] [revalidations:int] [numa_layout:int] [commits:int]\n");
         exit(-1);
     }
     if(argc > 3) {
@@ -58,6 +83,7 @@ int main(int argc, char *argv[]) {
     }
 
     pthread_mutex_init(&lock, NULL);
+    hpc_init();
     int ret = 0;
     int host_only = atoi(argv[1]);
     int global_lock_tbl_size = atoi(argv[2]);
@@ -65,7 +91,10 @@ int main(int argc, char *argv[]) {
     struct timespec start, end;
     env_t env;
     env_program_t program;
-    unsigned int thread_num = argc == 5 ? atoi(argv[4]) : 1;
+    unsigned int thread_num = argc > 4 ? atoi(argv[4]) : 1;
+    unsigned int revalidations = argc > 5 ? atoi(argv[5]) : 0;
+    int numa_mode = argc > 6 ? atoi(argv[6]) : NUMA_LAYOUT_OFF;
+    unsigned int commits = argc > 7 ? atoi(argv[7]) : 0;
     pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * thread_num);
     ret = env_init(&env, INTEL_PLATFORM);
     size_t read_set_sz =  global_lock_tbl_size / thread_num;
@@ -76,14 +105,30 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "%s", env_build_status(&program));
         }
 
-        shared_buf_t *glocks = create_shared_buffer(global_lock_tbl_size, &env, SH_BUF_RW);
+#ifdef DEBUG
+        fprintf(stderr, "%s: unified memory=%d\n", get_device_name(&env), env.host_unified_memory);
+#endif
+        shared_buf_t *glocks = create_shared_buffer_for(global_lock_tbl_size, &env, SH_BUF_READ, SH_ACCESS_HOST_TO_DEVICE);
+        report_strategy("glocks", glocks->size, glocks->strategy);
+        // validators create their buffers inside the timed region, report their placement now
+        report_strategy("read_set", read_set_sz, select_buffer_strategy(&env, read_set_sz, SH_ACCESS_HOST_TO_DEVICE));
+        report_strategy("abort", sizeof(int), select_buffer_strategy(&env, sizeof(int), SH_ACCESS_DEVICE_TO_HOST));
         queue_id_t qid = env_new_queue(&env);
+        hpc_begin(HPC_MAP);
         int *mapped_glocks = map_shbuf(glocks, qid, CL_MAP_WRITE);
+        hpc_end(HPC_MAP);
         for (int i = 0; i < glocks->size / sizeof(int); i++) {
             mapped_glocks[i] = 0;
         }
-        mapped_glocks[(read_set_sz) / sizeof(int)] = 999999999;
+        // the first lock past the first read-set, there is none with a single validator
+        if(read_set_sz < global_lock_tbl_size) {
+            mapped_glocks[(read_set_sz) / sizeof(int)] = 999999999;
+        }
+        hpc_begin(HPC_UNMAP);
         unmap_shbuf(glocks);
+        hpc_end(HPC_UNMAP);
+        // validators run on their own queues, the lock table must be on the device before they start
+        env_flush_queue((&env), qid);
 
         clock_gettime(CLOCK_MONOTONIC, &start);
         tx_args_t *tx_args = (tx_args_t *) malloc(sizeof(tx_args_t) * thread_num);
@@ -106,10 +151,27 @@ int main(int argc, char *argv[]) {
         destroy_shared_buffer(glocks);
         env_program_destroy(&program);
     } else {
-        int *glocks = (int *) malloc(global_lock_tbl_size);
+        commit_log_t log;
+        numa_layout_t layout;
+        if(commit_log_init(&log, COMMIT_LOG_CAPACITY)) {
+            fprintf(stderr, "Failed to allocate the commit log\n");
+            exit(-1);
+        }
+        if(numa_layout_init(&layout, numa_mode, get_num_cpus())) {
+            fprintf(stderr, "Failed to set up the host lock table\n");
+            exit(-1);
+        }
+        int *glocks = (int *) numa_alloc_table(&layout, global_lock_tbl_size);
+        if(!glocks) {
+            fprintf(stderr, "Failed to allocate the host lock table\n");
+            exit(-1);
+        }
         memset(glocks, 0, global_lock_tbl_size);
-        glocks[read_set_sz / sizeof(int)] = 999999999;
-        
+        // the first lock past the first read-set, there is none with a single validator
+        if(read_set_sz < global_lock_tbl_size) {
+            glocks[read_set_sz / sizeof(int)] = 999999999;
+        }
+
         clock_gettime(CLOCK_MONOTONIC, &start);
         tx_args_t *tx_args = (tx_args_t *) malloc(sizeof(tx_args_t) * thread_num);
 
@@ -119,7 +181,18 @@ int main(int argc, char *argv[]) {
             tx_args[i].readset_size = read_set_sz;
             tx_args[i].tid = i;
             tx_args[i].ho_glocks_size = global_lock_tbl_size;
-            pthread_create(threads + i, NULL, tx_validate_host_only, tx_args + i);
+            tx_args[i].log = &log;
+            tx_args[i].revalidations = revalidations;
+            tx_args[i].commits = commits;
+            tx_args[i].layout = &layout;
+            // pin each validator next to the slice of the table it checks
+            pthread_attr_t attr;
+            tx_args[i].node = numa_validator_node(&layout, i * read_set_sz, i);
+            if(numa_thread_attr(&layout, tx_args[i].node, &attr) || pthread_create(threads + i, &attr, tx_validate_host_only, tx_args + i)) {
+                fprintf(stderr, "Failed to start validator %d\n", i);
+                exit(-1);
+            }
+            pthread_attr_destroy(&attr);
         }
         //end_clock = rdtsc();
 
@@ -128,10 +201,23 @@ int main(int argc, char *argv[]) {
         }
         clock_gettime(CLOCK_MONOTONIC, &end);
         exec_time = ts_diff(&start, &end);
+#ifdef DEBUG
+        report_node_bandwidth(&layout, tx_args, thread_num);
+#endif
+        numa_free_table(&layout, glocks);
+        numa_layout_destroy(&layout);
+        commit_log_destroy(&log);
     }
 
     //printf("a");
     env_destroy(&env);
+    hpc_thread_close();
+    int ret_hpc = hpc_export_csv(host_only, global_lock_tbl_size, thread_num);
+    if(ret_hpc == -ERROR_HPC_IO) {
+        fprintf(stderr, "Could not write host profiler counters to %s\n", getenv(HPC_CSV_ENV));
+    } else if(ret_hpc == -ERROR_HPC_UNAVAILABLE) {
+        fprintf(stderr, "No hardware counter could be opened, nothing written to %s\n", getenv(HPC_CSV_ENV));
+    }
     //pclock(exec_time);
     printf("%llu\n", end_clock - start_clock);
     return ret;
@@ -139,17 +225,27 @@ int main(int argc, char *argv[]) {
 
 
 void populate_readset(shared_buf_t *buf, queue_id_t q_id) {
+    hpc_begin(HPC_POPULATE_READSET);
+    hpc_begin(HPC_MAP);
     int *read_set = (int *) map_shbuf(buf, q_id, CL_MAP_WRITE);
+    hpc_end(HPC_MAP);
     for(int i = 0; i < buf->size / sizeof(int); i++) {
         read_set[i] = i;
     }
+    hpc_begin(HPC_UNMAP);
     unmap_shbuf(buf);
+    hpc_end(HPC_UNMAP);
+    hpc_end(HPC_POPULATE_READSET);
 }
 
 void init_abort_flag(shared_buf_t *buf, queue_id_t q_id) {
+    hpc_begin(HPC_MAP);
     int *flag = (int *) map_shbuf(buf, q_id, CL_MAP_WRITE);
+    hpc_end(HPC_MAP);
     *flag = 0;
+    hpc_begin(HPC_UNMAP);
     unmap_shbuf(buf);
+    hpc_end(HPC_UNMAP);
 }
 
 void *tx_validate(void* _args) {
@@ -158,12 +254,13 @@ void *tx_validate(void* _args) {
     tx_args_t *args = (tx_args_t *)_args;
 
     pthread_mutex_lock(&lock);
-    shared_buf_t *read_set = create_shared_buffer(args->readset_size, args->program->env, SH_BUF_READ);
-    shared_buf_t *abort = create_shared_buffer(sizeof(int), args->program->env, SH_BUF_RW);
+    shared_buf_t *read_set = create_shared_buffer_for(args->readset_size, args->program->env, SH_BUF_READ, SH_ACCESS_HOST_TO_DEVICE);
+    shared_buf_t *abort = create_shared_buffer_for(sizeof(int), args->program->env, SH_BUF_RW, SH_ACCESS_DEVICE_TO_HOST);
     queue_id_t q_id = env_new_queue(args->program->env);
 
     if(!valid_queue_id(q_id)) {
         fprintf(stderr, "Invalid queue_id");
+        hpc_thread_close();
         return NULL;
     }
     
@@ -183,45 +280,130 @@ void *tx_validate(void* _args) {
     reterr |= env_set_karg(&validation_kernel, sizeof(int), &(args->tid));
 
 
+    hpc_begin(HPC_ENQUEUE);
     reterr |= env_enqueue_kernel(&validation_kernel, q_id, 1);
+    hpc_end(HPC_ENQUEUE);
 
     if(reterr) {
         fprintf(stderr, "Transaction failed to set kernel args");
+        hpc_thread_close();
         return NULL;
     }
 
     env_flush_queue(args->program->env, q_id);
     pthread_mutex_unlock(&lock);
     end_clock = rdtsc();
+    hpc_thread_close();
     //printf("thread id=%d - abort=%d\n", args->tid, ((int *) abort->host_handler)[0]);
 
     return NULL;
 }
 
+static int ho_check_lock(size_t index, void *_rs) {
+    ho_readset_t *rs = (ho_readset_t *) _rs;
+    return rs->read_set[index - rs->offset] < rs->glocks[index];
+}
+
+/// Validates ``rs`` against the locks changed since ``*validated_at``,
+/// rescanning the whole read-set only when the commit log has wrapped.
+/// On return ``*validated_at`` holds the stamp the read-set is now valid at.
+static int ho_validate(commit_log_t *log, ho_readset_t *rs, commit_stamp_t *validated_at) {
+    commit_stamp_t now = commit_log_now(log);
+    int ret = commit_log_for_each(log, *validated_at, now, rs->offset, rs->offset + rs->length, ho_check_lock, rs);
+    if(ret == -ERROR_COMMIT_LOG_WRAPPED) {
+        ret = 0;
+        for(size_t i = 0; i < rs->length; i++) {
+            if(rs->read_set[i] < rs->glocks[i + rs->offset]) {
+                ret = 1;
+                break;
+            }
+        }
+    }
+    *validated_at = now;
+    return ret;
+}
+
+/// Stands in for another transaction committing a write to a random lock.
+/// It publishes the version the lock already holds, so it never makes a
+/// validator abort, but every validator still has to check it. The lock is
+/// rewritten atomically since other committers and validators touch it concurrently.
+static void ho_commit(tx_args_t *args, unsigned int *seed) {
+    size_t index = rand_r(seed) % (args->ho_glocks_size / sizeof(int));
+    int *lock = args->ho_glocks + index;
+    __atomic_store_n(lock, __atomic_load_n(lock, __ATOMIC_RELAXED), __ATOMIC_RELEASE);
+    commit_log_append(args->log, index);
+}
+
+/// Validates and adds the cycles it took to the validator's per node figures,
+/// so the simulated commits between validations are left out.
+static int ho_validate_timed(tx_args_t *args, ho_readset_t *rs, commit_stamp_t *validated_at) {
+    hpc_begin(HPC_VALIDATE_HOST);
+    unsigned long long start = rdtsc();
+    int ret = ho_validate(args->log, rs, validated_at);
+    args->cycles += rdtsc() - start;
+    hpc_end(HPC_VALIDATE_HOST);
+    return ret;
+}
+
 void *tx_validate_host_only(void* _args) {
     start_clock = rdtsc();
     tx_args_t *args = (tx_args_t *) _args;
     int abort = 0;
     int *read_set = (int *) malloc(args->readset_size);
+    commit_stamp_t validated_at = COMMIT_LOG_NEVER;
+    unsigned int seed = args->tid;
 
+    hpc_begin(HPC_POPULATE_READSET);
     for(int i = 0; i < args->readset_size / sizeof(int); i++) {
         read_set[i] = i;
     }
-
-    int offset = args->tid*args->readset_size / sizeof(int);
-    for(int i = 0; i < args->readset_size / sizeof(int); i++) {
-        if(read_set[i] < args->ho_glocks[i + offset]) {
-            abort = 1;
-            break;
+    hpc_end(HPC_POPULATE_READSET);
+
+    ho_readset_t rs = {
+        .read_set = read_set,
+        .glocks = args->ho_glocks,
+        .offset = args->tid * args->readset_size / sizeof(int),
+        .length = args->readset_size / sizeof(int)
+    };
+    // per node figures only count validation: the private read-set is node local on every layout
+    args->cycles = 0;
+    if(args->node < 0) {
+        args->node = numa_current_node(args->layout);
+    }
+    // first validation is a full scan, following ones only look at the
+    // commits every validator issued since, or rescan if there were too many
+    abort = ho_validate_timed(args, &rs, &validated_at);
+    for(int i = 0; !abort && i < args->revalidations; i++) {
+        for(int c = 0; c < args->commits; c++) {
+            ho_commit(args, &seed);
         }
+        abort = ho_validate_timed(args, &rs, &validated_at);
     }
 
     free(read_set);
     //printf("thread id=%d - abort=%d\n", args->tid, abort);
     end_clock = rdtsc();
+    hpc_thread_close();
     return (void *)abort;
 }
 
+/// Prints, for every node, the bytes its validators checked per cycle.
+/// Validators of a node run in parallel, so the slowest one bounds it.
+void report_node_bandwidth(const numa_layout_t *layout, const tx_args_t *tx_args, unsigned int thread_num) {
+    for(int n = 0; n < layout->num_nodes; n++) {
+        size_t bytes = 0;
+        unsigned long long cycles = 0;
+        for(int i = 0; i < thread_num; i++) {
+            if(tx_args[i].node != n) continue;
+            bytes += tx_args[i].readset_size;
+            cycles = tx_args[i].cycles > cycles ? tx_args[i].cycles : cycles;
+        }
+        if(cycles) {
+            fprintf(stderr, "node %d: %zu bytes, %llu cycles, %.4f bytes/cycle\n", layout->node_ids[n], bytes, cycles, (double) bytes / cycles);
+        }
+    }
+}
+
 struct timespec ts_diff(struct timespec *start, struct timespec *end) {
     struct timespec ret = {.tv_nsec = 0, .tv_sec = 0};
     ret.tv_sec = end->tv_sec - start->tv_sec;
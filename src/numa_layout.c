@@ -0,0 +1,202 @@
+#define _GNU_SOURCE  // cpu_set_t, pthread_attr_setaffinity_np
+#include <numa_layout.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#ifdef ENABLE_NUMA
+#include <numa.h>
+#endif
+
+#define PAGE_SIZE 4096
+#define round_up_page(_sz) (((_sz) + PAGE_SIZE - 1) & ~((size_t) PAGE_SIZE - 1))
+
+/// Cpus this process may run on, so that pinning never targets an offline
+/// cpu or one outside the cgroup/taskset.
+static void allowed_cpus(cpu_set_t *set, long num_cpus) {
+    if(sched_getaffinity(0, sizeof(cpu_set_t), set)) {
+        CPU_ZERO(set);
+        for(int cpu = 0; cpu < num_cpus && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, set);
+        }
+    }
+}
+
+static int single_node(numa_layout_t *layout, long num_cpus) {
+    cpu_set_t allowed;
+    int c = 0;
+    allowed_cpus(&allowed, num_cpus);
+    for(int cpu = 0; cpu < CPU_SETSIZE && c < num_cpus; cpu++) {
+        if(CPU_ISSET(cpu, &allowed)) {
+            layout->cpus[c++] = cpu;
+        }
+    }
+    layout->num_nodes = 1;
+    layout->node_ids[0] = 0;
+    layout->node_cpus[0] = 0;
+    layout->node_cpus[1] = c;
+    return 0;
+}
+
+#ifdef ENABLE_NUMA
+/// Groups cpus by node, skipping memory-only nodes.
+static int detect_nodes(numa_layout_t *layout, long num_cpus) {
+    if(numa_available() < 0 || numa_max_node() == 0) {
+        return single_node(layout, num_cpus);
+    }
+    struct bitmask *node_mask = numa_allocate_cpumask();
+    cpu_set_t allowed;
+    int n = 0, c = 0;
+    allowed_cpus(&allowed, num_cpus);
+    for(int node = 0; node <= numa_max_node(); node++) {
+        if(numa_node_to_cpus(node, node_mask)) {
+            continue;
+        }
+        int first = c;
+        for(int cpu = 0; cpu < num_cpus; cpu++) {
+            if(numa_bitmask_isbitset(node_mask, cpu) && CPU_ISSET(cpu, &allowed)) {
+                layout->cpus[c++] = cpu;
+            }
+        }
+        if(c > first) {
+            layout->node_ids[n] = node;
+            layout->node_cpus[n++] = first;
+        }
+    }
+    numa_free_cpumask(node_mask);
+    if(!n) {
+        return single_node(layout, num_cpus);
+    }
+    layout->num_nodes = n;
+    layout->node_cpus[n] = c;
+    return 0;
+}
+#else
+#define detect_nodes single_node
+#endif
+
+int numa_layout_init(numa_layout_t *layout, int mode, long num_cpus) {
+    if(mode < NUMA_LAYOUT_OFF || mode > NUMA_LAYOUT_PARTITION) {
+        return -ERROR_NUMA_BAD_MODE;
+    }
+#ifdef ENABLE_NUMA
+    if(numa_available() >= 0 && numa_num_configured_cpus() > num_cpus) {
+        num_cpus = numa_num_configured_cpus();  // cpu ids may have holes when some are offline
+    }
+#endif
+    memset(layout, 0, sizeof(numa_layout_t));
+    layout->mode = mode;
+    // at most one node per cpu
+    layout->node_ids = (int *) malloc(sizeof(int) * num_cpus);
+    layout->cpus = (int *) malloc(sizeof(int) * num_cpus);
+    layout->node_cpus = (int *) malloc(sizeof(int) * (num_cpus + 1));
+    layout->next_cpu = (int *) calloc(num_cpus, sizeof(int));
+    if(!layout->node_ids || !layout->cpus || !layout->node_cpus || !layout->next_cpu) {
+        numa_layout_destroy(layout);
+        return -ERROR_NUMA_NO_MEMORY;
+    }
+    return detect_nodes(layout, num_cpus);
+}
+
+void numa_layout_destroy(numa_layout_t *layout) {
+    free(layout->node_ids);
+    free(layout->cpus);
+    free(layout->node_cpus);
+    free(layout->next_cpu);
+}
+
+/// Allocates a table of ``size`` bytes. Outside NUMA_LAYOUT_OFF the pages
+/// are mapped lazily with a memory policy set before first touch, so they
+/// land on the intended node whichever thread initializes them.
+void *numa_alloc_table(numa_layout_t *layout, size_t size) {
+    if(layout->mode == NUMA_LAYOUT_OFF) {
+        return malloc(size);
+    }
+    layout->table_size = round_up_page(size);
+    layout->node_span = round_up_page((layout->table_size + layout->num_nodes - 1) / layout->num_nodes);
+    char *table = mmap(NULL, layout->table_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(table == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef ENABLE_NUMA
+    if(layout->num_nodes > 1) {
+        if(layout->mode == NUMA_LAYOUT_INTERLEAVE) {
+            struct bitmask *nodes = numa_allocate_nodemask();
+            for(int n = 0; n < layout->num_nodes; n++) {
+                numa_bitmask_setbit(nodes, layout->node_ids[n]);
+            }
+            numa_interleave_memory(table, layout->table_size, nodes);
+            numa_free_nodemask(nodes);
+        } else {
+            for(int n = 0; n < layout->num_nodes; n++) {
+                size_t offset = n * layout->node_span;
+                if(offset >= layout->table_size) break;
+                size_t len = layout->table_size - offset < layout->node_span ? layout->table_size - offset : layout->node_span;
+                numa_tonode_memory(table + offset, len, layout->node_ids[n]);
+            }
+        }
+    }
+#endif
+    return table;
+}
+
+void numa_free_table(numa_layout_t *layout, void *table) {
+    if(layout->mode == NUMA_LAYOUT_OFF) {
+        free(table);
+    } else {
+        munmap(table, layout->table_size);
+    }
+}
+
+/// Node a validator for the range starting at byte ``offset`` of the table
+/// should run on: the owner of the range when partitioned, round robin
+/// on ``tid`` when interleaved, -1 (anywhere) when the layout is off.
+int numa_validator_node(const numa_layout_t *layout, size_t offset, int tid) {
+    switch (layout->mode) {
+        case NUMA_LAYOUT_PARTITION: {
+            size_t node = offset / layout->node_span;
+            return node < layout->num_nodes ? (int) node : layout->num_nodes - 1;
+        }
+        case NUMA_LAYOUT_INTERLEAVE: return tid % layout->num_nodes;
+    }
+    return -1;
+}
+
+/// Node, as an index into the layout, of the cpu the caller is running on.
+/// Falls back to node 0 when it cannot be told or without libnuma.
+int numa_current_node(const numa_layout_t *layout) {
+#ifdef ENABLE_NUMA
+    int cpu = sched_getcpu();
+    int node = cpu < 0 || numa_available() < 0 ? -1 : numa_node_of_cpu(cpu);
+    for(int n = 0; node >= 0 && n < layout->num_nodes; n++) {
+        if(layout->node_ids[n] == node) {
+            return n;
+        }
+    }
+#endif
+    return 0;
+}
+
+/// Initializes ``attr`` pinning the thread to the next cpu of ``node``.
+/// Returns 0 or an errno value, in which case ``attr`` is not initialized.
+/// Not thread safe: meant to be called by the thread spawning validators.
+int numa_thread_attr(numa_layout_t *layout, int node, pthread_attr_t *attr) {
+    int ret = pthread_attr_init(attr);
+    if(ret || node < 0 || node >= layout->num_nodes) {
+        return ret;
+    }
+    int first = layout->node_cpus[node];
+    int count = layout->node_cpus[node + 1] - first;
+    if(!count) {
+        return ret;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(layout->cpus[first + layout->next_cpu[node]++ % count], &set);
+    ret = pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &set);
+    if(ret) {
+        pthread_attr_destroy(attr);
+    }
+    return ret;
+}
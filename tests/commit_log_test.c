@@ -0,0 +1,105 @@
+// Concurrent writers/readers check of the commit log. Writers record the
+// index they appended under the stamp ``commit_log_append`` returned,
+// readers walking the log must either see exactly that index for every
+// stamp or report that the window wrapped.
+#define _POSIX_C_SOURCE 200809L  // sched_yield
+#include <commit_log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define CAPACITY 8  // small, so that slots are recycled while readers walk them
+#define COMMITS 100000  // per test case, split among the writers
+#define READERS 3
+#define MAX_WRITERS 4
+
+commit_log_t commit_log;
+_Atomic size_t *appended;  // index appended under each stamp, 0 until the writer got its stamp back
+_Atomic int writers_done;
+
+typedef struct {
+    commit_stamp_t next;  // stamp of the next index the callback should see
+    unsigned long errors;
+} reader_state_t;
+
+static int check_index(size_t index, void *_state) {
+    reader_state_t *state = (reader_state_t *) _state;
+    size_t expected;
+    // the writer may not have returned from commit_log_append yet
+    while(!(expected = atomic_load(appended + state->next))) {
+        sched_yield();
+    }
+    if(index != expected) {
+        state->errors++;
+    }
+    state->next++;
+    // lag behind the writers so that they recycle slots in the middle of our walk
+    for(volatile int spin = 0; spin < 64; spin++);
+    return 0;
+}
+
+void *writer(void *_writers) {
+    static _Atomic size_t next_index = 1;
+    int writers = *(int *) _writers;
+    for(int i = 0; i < COMMITS / writers; i++) {
+        size_t index = atomic_fetch_add(&next_index, 1);
+        commit_stamp_t stamp = commit_log_append(&commit_log, index);
+        atomic_store(appended + stamp, index);
+    }
+    atomic_fetch_add(&writers_done, 1);
+    return NULL;
+}
+
+void *reader(void *_errors) {
+    unsigned long walked = 0, wrapped = 0;
+    reader_state_t state = {.errors = 0};
+    while(atomic_load(&writers_done) == 0) {
+        commit_stamp_t now = commit_log_now(&commit_log);
+        commit_stamp_t since = now > CAPACITY ? now - CAPACITY : COMMIT_LOG_NEVER + 1;
+        state.next = since + 1;
+        if(commit_log_for_each(&commit_log, since, now, 0, (size_t) -1, check_index, &state) == -ERROR_COMMIT_LOG_WRAPPED) {
+            wrapped++;
+        } else {
+            walked++;
+        }
+    }
+    *(unsigned long *) _errors = state.errors;
+    fprintf(stderr, "reader: %lu walks, %lu wrapped, %lu wrong indices\n", walked, wrapped, state.errors);
+    return NULL;
+}
+
+static int run_case(int writers) {
+    pthread_t w[MAX_WRITERS], r[READERS];
+    unsigned long errors[READERS];
+    int ret = 0;
+    if(commit_log_init(&commit_log, CAPACITY)) {
+        fprintf(stderr, "commit_log_init failed\n");
+        return 1;
+    }
+    // stamps start right after COMMIT_LOG_NEVER + 1
+    appended = (_Atomic size_t *) calloc(COMMITS + 2, sizeof(size_t));
+    atomic_store(&writers_done, 0);
+    for(int i = 0; i < READERS; i++) {
+        pthread_create(r + i, NULL, reader, errors + i);
+    }
+    for(int i = 0; i < writers; i++) {
+        pthread_create(w + i, NULL, writer, &writers);
+    }
+    for(int i = 0; i < writers; i++) {
+        pthread_join(w[i], NULL);
+    }
+    for(int i = 0; i < READERS; i++) {
+        pthread_join(r[i], NULL);
+        ret |= errors[i] != 0;
+    }
+    free((void *) appended);
+    commit_log_destroy(&commit_log);
+    printf("commit_log_test, %d writer(s): %s\n", writers, ret ? "FAILED" : "OK");
+    return ret;
+}
+
+int main(void) {
+    // several writers also contend on slots whose previous owner did not publish yet
+    return run_case(1) | run_case(MAX_WRITERS);
+}